@@ -0,0 +1,10 @@
+echo hello world
+echo   spaced    out   words
+pwd
+mkdir -p sub/dir
+cd sub/dir
+pwd
+cd ../..
+pwd
+type echo
+type cd
@@ -0,0 +1,8 @@
+true
+false
+printf '%s\n' alpha beta
+seq 3
+expr 6 \* 7
+basename /usr/local/bin
+dirname /usr/local/bin
+date -d @0 -u +%Y
@@ -0,0 +1,7 @@
+echo one two three | wc -w
+printf 'c\nb\na\n' | sort | head -2
+printf 'x\ny\nx\n' | sort | uniq -c | sort -rn
+seq 1 2000 | grep 7 | wc -l
+yes | head -3
+seq 1 100000 | tail -1
+ls / | grep -c bin
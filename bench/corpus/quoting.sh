@@ -0,0 +1,7 @@
+echo 'single quoted   spaces'
+echo "double quoted   spaces"
+echo 'mixed'"quotes"unquoted
+echo "it's" 'say "hi"'
+echo a\ b c\\d
+echo "escaped \"inner\" quotes"
+echo "3>2" "<html>" 2\>x
@@ -0,0 +1,21 @@
+echo first > out.txt
+echo second >> out.txt
+echo third 1>> out.txt
+cat out.txt
+ls missing-file 2> err.txt
+wc -l err.txt
+ls missing-file 2>> err.txt
+wc -l err.txt
+cat < out.txt
+exec 3>fd3.txt
+echo via three >&3
+echo again >&3
+exec 3>&-
+cat fd3.txt
+exec 4<out.txt
+head -1 <&4
+exec 4<&-
+ls missing-file 2>&1 > order.txt
+cat order.txt
+echo a >&-
+echo b
@@ -0,0 +1,137 @@
+#!/bin/sh
+#
+# Differential check of the shell against a reference shell.
+#
+# Every script in bench/corpus is run through both shells from a fresh working
+# directory. Their stdout must match (the shell's echoed prompt lines are
+# stripped first). Each script is then timed over REPEAT runs, launch cost
+# excluded, and the harness fails if the shell's extra wall-clock time per
+# command exceeds that script's limit in bench/corpus/limits.
+# With STRACE=1 and strace installed, syscall totals per command are reported
+# as well.
+#
+# Usage: bench/differential.sh [path/to/shell]
+#
+# Environment:
+#   REFERENCE_SHELL  shell to compare against (default /bin/sh)
+#   REPEAT           timed runs per script (default 20)
+#   MAX_OVERHEAD_US  limit for scripts not listed in bench/corpus/limits (default 5000)
+#   STRACE           set to 1 to report syscall counts
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+SHELL_BIN=${1:-$HERE/../build/shell}
+SHELL_BIN=$(cd "$(dirname "$SHELL_BIN")" && pwd)/$(basename "$SHELL_BIN")
+REFERENCE_SHELL=${REFERENCE_SHELL:-/bin/sh}
+REPEAT=${REPEAT:-20}
+MAX_OVERHEAD_US=${MAX_OVERHEAD_US:-5000}
+CORPUS=$HERE/corpus
+
+# Keep the shell's history and prompt out of the comparison
+unset HISTFILE PS1
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+now_us() {
+  echo $(($(date +%s%N) / 1000))
+}
+
+# Allowed extra wall-clock microseconds per command for `script`
+overhead_limit() {
+  limit=$(awk -v name="$1" '$1 == name { print $2 }' "$CORPUS/limits")
+  echo "${limit:-$MAX_OVERHEAD_US}"
+}
+
+# Runs `script` with `sh_bin` from a fresh, identically named directory
+run() {
+  rm -rf "$WORK/run"
+  mkdir "$WORK/run"
+  (cd "$WORK/run" && "$1" < "$2" 2> /dev/null) || true
+}
+
+# Removes the "$ <line>" prompt echo readline prints for each input line
+strip_prompts() {
+  awk 'BEGIN { n = 0; i = 0 }
+  NR == FNR { cmds[n++] = $0; next }
+  {
+    want = "$ " (i < n ? cmds[i] : "")
+    if (length($0) >= length(want) && substr($0, length($0) - length(want) + 1) == want) {
+      printf "%s", substr($0, 1, length($0) - length(want))
+      i++
+      next
+    }
+    print
+  }' "$1" -
+}
+
+# Sets `elapsed_us` for REPEAT runs of `script` with `sh_bin`
+time_runs() {
+  start=$(now_us)
+  i=0
+  while [ "$i" -lt "$REPEAT" ]; do
+    run "$1" "$2" > /dev/null
+    i=$((i + 1))
+  done
+  elapsed_us=$(($(now_us) - start))
+}
+
+syscalls() {
+  rm -rf "$WORK/run"
+  mkdir "$WORK/run"
+  (cd "$WORK/run" && strace -f -c -o "$WORK/strace" "$1" < "$2" > /dev/null 2>&1) || true
+  awk '$NF == "total" { print $(NF - 2) }' "$WORK/strace"
+}
+
+# Launch cost is measured on an empty script and excluded from the per-command figures
+: > "$WORK/empty.sh"
+time_runs "$SHELL_BIN" "$WORK/empty.sh"
+startup_ours=$elapsed_us
+time_runs "$REFERENCE_SHELL" "$WORK/empty.sh"
+startup_ref=$elapsed_us
+echo "startup: shell $((startup_ours / REPEAT))us, reference $((startup_ref / REPEAT))us"
+
+failures=0
+printf '%-18s %5s %12s %12s %12s %12s %s\n' script cmds "shell us/cmd" "ref us/cmd" "overhead" "limit" status
+for script in "$CORPUS"/*.sh; do
+  name=$(basename "$script")
+  cmds=$(grep -c . "$script")
+  limit=$(overhead_limit "$name")
+
+  run "$SHELL_BIN" "$script" | strip_prompts "$script" > "$WORK/ours.out"
+  run "$REFERENCE_SHELL" "$script" > "$WORK/ref.out"
+  status=ok
+  if ! cmp -s "$WORK/ours.out" "$WORK/ref.out"; then
+    status=OUTPUT-MISMATCH
+    diff -u "$WORK/ref.out" "$WORK/ours.out" | sed "s|^|  $name: |" >&2 || true
+  fi
+
+  time_runs "$SHELL_BIN" "$script"
+  ours_us=$elapsed_us
+  time_runs "$REFERENCE_SHELL" "$script"
+  ref_us=$elapsed_us
+
+  per_cmd_ours=$(((ours_us - startup_ours) / (REPEAT * cmds)))
+  per_cmd_ref=$(((ref_us - startup_ref) / (REPEAT * cmds)))
+  overhead=$((per_cmd_ours - per_cmd_ref))
+  if [ "$status" = ok ] && [ "$overhead" -gt "$limit" ]; then
+    status=SLOW
+  fi
+  [ "$status" = ok ] || failures=$((failures + 1))
+
+  printf '%-18s %5d %12d %12d %12d %12d %s\n' "$name" "$cmds" "$per_cmd_ours" "$per_cmd_ref" "$overhead" \
+    "$limit" "$status"
+
+  if [ "${STRACE:-0}" = 1 ] && command -v strace > /dev/null; then
+    ours_calls=$(syscalls "$SHELL_BIN" "$script")
+    ref_calls=$(syscalls "$REFERENCE_SHELL" "$script")
+    printf '  syscalls: shell %d, ref %d (%+d per command)\n' "$ours_calls" "$ref_calls" \
+      $(((ours_calls - ref_calls) / cmds))
+  fi
+done
+
+if [ "$failures" -gt 0 ]; then
+  echo "$failures script(s) failed (output mismatch or overhead above the script's limit)" >&2
+  exit 1
+fi
@@ -0,0 +1,26 @@
+#!/bin/sh
+#
+# Measures GB/s through a 4-stage `cat` pipeline run by the shell, once with
+# the kernel default pipe size and once with `set -o pipebuf=SIZE`.
+#
+# Usage: bench/pipeline_throughput.sh [path/to/shell] [bytes] [pipebuf]
+
+set -e
+
+SHELL_BIN=${1:-$(dirname "$0")/../build/shell}
+BYTES=${2:-4294967296}
+PIPEBUF=${3:-1M}
+
+PIPELINE="head -c $BYTES /dev/zero | cat | cat | cat | cat > /dev/null"
+
+run() {
+  start=$(date +%s.%N)
+  printf '%s\n%s\n' "$1" "$PIPELINE" | "$SHELL_BIN" > /dev/null
+  end=$(date +%s.%N)
+  echo "$start $end" | awk -v bytes="$BYTES" -v label="$2" \
+    '{ s = $2 - $1; printf "%-16s %8.3fs %8.2f GB/s\n", label, s, bytes / s / 1e9 }'
+}
+
+echo "$BYTES bytes through: $PIPELINE"
+run "set +o pipebuf" "pipebuf=default"
+run "set -o pipebuf=$PIPEBUF" "pipebuf=$PIPEBUF"
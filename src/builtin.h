@@ -2,12 +2,29 @@
 #define BUILTIN_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 
+// C ABI exported as `<name>_run` or `run` by shared objects loaded with `enable -f`.
+// argv[0] is the builtin name; in/out/err are the shell's (possibly redirected) fds.
+extern "C" typedef int (*shell_builtin_run)(int argc, char **argv, int in, int out, int err);
+
 namespace builtin {
 
-bool is_builtin(const std::string &name);
-int execute(const std::string &cmd, const std::vector<std::string> &args);
+using Fn = int (*)(const std::vector<std::string> &args);
+
+// A resolved builtin: a compiled-in function or an entry point loaded with `enable -f`
+struct Handler {
+  Fn fn = nullptr;
+  shell_builtin_run loaded = nullptr;
+  const char *name = nullptr; // argv[0] passed to loaded builtins
+
+  explicit operator bool() const { return fn || loaded; }
+  int operator()(const std::vector<std::string> &args) const;
+};
+
+// Compiled-in builtins resolve with a single perfect-hash lookup; loaded ones are checked after
+Handler find(std::string_view name);
 std::vector<std::string> get_builtin_names();
 
 } // namespace builtin
@@ -1,18 +1,23 @@
 #ifndef COMMAND_H
 #define COMMAND_H
 
-#include <optional>
 #include <string>
 #include <vector>
 
 namespace command {
-// Redirection information for a command
+// Redirection of one descriptor: [N]<file, [N]>file, [N]>>file, [N]>&M, [N]>&-
+struct FdRedirection {
+  enum class Kind { Read, Write, Append, Dup, Close };
+  int fd;
+  Kind kind;
+  std::string file; // Read, Write, Append
+  int target = -1;  // Dup: the descriptor fd becomes a copy of
+};
+
+// Redirection information for a command, kept in source order:
+// `2>&1 >out` leaves stderr on the terminal, `>out 2>&1` sends both to out
 struct Redirection {
-  std::optional<std::string> input_file;  // <
-  std::optional<std::string> output_file; // > or 1>
-  bool append_output = false;             // true for >>, false for >
-  std::optional<std::string> error_file;  // 2>
-  bool append_error = false;              // true for 2>>, false for 2>
+  std::vector<FdRedirection> fds;
 };
 
 struct ParsedCommand {
@@ -23,4 +28,3 @@ struct ParsedCommand {
 } // namespace command
 
 #endif
-
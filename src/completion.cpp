@@ -1,5 +1,9 @@
 #include "completion.h"
+#include "path_cache.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <optional>
 #include <readline/history.h>
@@ -61,24 +65,52 @@ public:
     for (auto c : word) {
       if (curr->children().find(c) == curr->children().end()) {
         curr->children()[c] = new TrieNode(curr);
+        ++nodes_;
       }
       curr = curr->children()[c];
     }
+    if (!curr->eow()) {
+      ++words_;
+    }
     curr->set_eow(true);
   }
 
-  void get_all_completions(const std::string_view &prefix, std::vector<std::string> &results) {
-    TrieNode *node = find_prefix(prefix);
+  // Removes `word`, pruning the nodes no other word uses
+  void erase(const std::string_view &word) {
+    TrieNode *curr = const_cast<TrieNode *>(find_prefix(word));
+    if (!curr || !curr->eow()) {
+      return;
+    }
+    curr->set_eow(false);
+    --words_;
+    for (size_t depth = word.size(); depth > 0 && !curr->eow() && !curr->has_children(); --depth) {
+      TrieNode *parent = *curr->parent();
+      parent->children().erase(word[depth - 1]);
+      delete curr;
+      --nodes_;
+      curr = parent;
+    }
+  }
+
+  size_t nodes() const { return nodes_; }
+  size_t words() const { return words_; }
+
+  // Node objects plus each children map's bucket array and per-element nodes
+  size_t bytes() const { return subtree_bytes(root_); }
+
+  // Streams completions of `prefix` in lexicographic order until `visit` returns false
+  template <typename Visit> void for_each_completion(const std::string_view &prefix, Visit &&visit) const {
+    const TrieNode *node = find_prefix(prefix);
     if (!node) {
       return;
     }
     std::string current(prefix);
-    dfs_collect(node, current, results);
+    dfs_visit(node, current, visit);
   }
 
 private:
-  TrieNode *find_prefix(const std::string_view &prefix) {
-    TrieNode *curr = root_;
+  const TrieNode *find_prefix(const std::string_view &prefix) const {
+    const TrieNode *curr = root_;
     for (auto c : prefix) {
       auto it = curr->children().find(c);
       if (it == curr->children().end()) {
@@ -89,15 +121,37 @@ private:
     return curr;
   }
 
-  void dfs_collect(TrieNode *node, std::string &current, std::vector<std::string> &results) {
-    if (node->eow()) {
-      results.push_back(current);
+  // Returns false once `visit` asked to stop
+  template <typename Visit> static bool dfs_visit(const TrieNode *node, std::string &current, Visit &visit) {
+    if (node->eow() && !visit(std::string_view(current))) {
+      return false;
     }
+    std::vector<char> keys;
+    keys.reserve(node->children().size());
     for (const auto &[c, child] : node->children()) {
+      keys.push_back(c);
+    }
+    std::sort(keys.begin(), keys.end());
+    for (auto c : keys) {
       current.push_back(c);
-      dfs_collect(child, current, results);
+      bool more = dfs_visit(node->children().at(c), current, visit);
       current.pop_back();
+      if (!more) {
+        return false;
+      }
     }
+    return true;
+  }
+
+  static size_t subtree_bytes(const TrieNode *node) {
+    using Children = std::unordered_map<char, TrieNode *>;
+    const auto &children = node->children();
+    size_t bytes = sizeof(TrieNode) + children.bucket_count() * sizeof(void *) +
+                   children.size() * (sizeof(void *) + sizeof(Children::value_type));
+    for (const auto &[c, child] : children) {
+      bytes += subtree_bytes(child);
+    }
+    return bytes;
   }
 
   void delete_subtree(TrieNode *node) {
@@ -111,44 +165,124 @@ private:
   }
 
   TrieNode *root_;
+  size_t nodes_ = 1;
+  size_t words_ = 0;
 };
 
+// Builtins; PATH commands are served from the path_cache snapshot
 Trie cmd_trie;
 
+size_t last_total = 0; // Matches for the last completion, of which at most the limit were materialised
+
+// Lists the matches readline was given and says how many were left out
+void display_matches(char **matches, int num_matches, int max_length) {
+  rl_display_match_list(matches, num_matches, max_length);
+  if (last_total > static_cast<size_t>(num_matches)) {
+    fprintf(rl_outstream, "(%d of %zu matches shown)", num_matches, last_total);
+    rl_crlf();
+  }
+  rl_forced_update_display();
+}
+
 } // namespace
 
 namespace completion {
 
-void setup() { rl_attempted_completion_function = completer; }
-
 void register_commands(const std::vector<std::string> &cmds) {
   for (const auto &cmd : cmds) {
     cmd_trie.insert(cmd);
   }
 }
 
-// Readline completion generator
-static char *completion_generator(const char *text, int state) {
-  static std::vector<std::string> matches;
-  static size_t index;
+void unregister_command(const std::string &cmd) { cmd_trie.erase(cmd); }
 
-  if (state == 0) {
-    matches.clear();
-    index = 0;
-    cmd_trie.get_all_completions(text, matches);
-  }
+Stats stats() {
+  // Builtins that are also on PATH are listed once by the completer, so count them once
+  size_t entries = path_cache::size();
+  cmd_trie.for_each_completion("", [&](std::string_view word) {
+    if (!path_cache::lookup(word)) {
+      ++entries;
+    }
+    return true;
+  });
+  return {cmd_trie.nodes(), cmd_trie.bytes(), path_cache::image_bytes(), path_cache::mapped(), entries};
+}
 
-  if (index < matches.size()) {
-    return strdup(matches[index++].c_str());
-  }
-  return nullptr;
+void setup() {
+  rl_attempted_completion_function = completer;
+  rl_completion_display_matches_hook = display_matches;
 }
 
-// Readline attempted completion callback
-char **completer(const char *text, int start, int end) {
+// Readline attempted completion callback. Matches come from two sorted sources, the
+// builtin trie and the snapshot's name table, merged without duplicates. matches[0] is the
+// longest common prefix, followed by at most rl_completion_query_items matches, so a short
+// prefix on a large PATH never copies every command.
+char **completer(const char *text, [[maybe_unused]] int start, [[maybe_unused]] int end) {
   rl_attempted_completion_over = 1; // Disable filename completion
-  return rl_completion_matches(text, completion_generator);
+
+  path_cache::load(); // Picks up programs installed since the last lookup
+  std::string_view prefix(text);
+  auto [first, last] = path_cache::prefix_range(prefix);
+
+  // The trie only holds builtins, so its matches are few enough to collect
+  std::vector<std::string> builtins;
+  cmd_trie.for_each_completion(prefix, [&](std::string_view word) {
+    builtins.emplace_back(word);
+    return true;
+  });
+
+  last_total = last - first;
+  for (const auto &word : builtins) {
+    if (!path_cache::lookup(word)) {
+      ++last_total;
+    }
+  }
+  if (last_total == 0) {
+    return nullptr;
+  }
+
+  // The common prefix of a sorted range is the common prefix of its two ends
+  std::optional<std::string> lcp;
+  auto narrow = [&](std::string_view word) {
+    if (!lcp) {
+      lcp = std::string(word);
+      return;
+    }
+    auto mismatch = std::mismatch(lcp->begin(), lcp->end(), word.begin(), word.end());
+    lcp->erase(mismatch.first, lcp->end());
+  };
+  if (first < last) {
+    narrow(path_cache::name_at(first));
+    narrow(path_cache::name_at(last - 1));
+  }
+  for (const auto &word : builtins) {
+    narrow(word);
+  }
+
+  size_t limit = rl_completion_query_items > 0 ? static_cast<size_t>(rl_completion_query_items) : last_total;
+  size_t shown = std::min(last_total, limit);
+
+  auto matches = static_cast<char **>(malloc((shown + 2) * sizeof(char *)));
+  matches[0] = strdup(lcp->c_str());
+  if (last_total == 1) {
+    matches[1] = nullptr; // A single match is returned in matches[0] alone
+    return matches;
+  }
+  size_t n = 1;
+  auto emit = [&](std::string_view word) { matches[n++] = strndup(word.data(), word.size()); };
+  auto b = builtins.begin();
+  for (uint32_t i = first; n <= shown && (i < last || b != builtins.end());) {
+    if (i == last || (b != builtins.end() && std::string_view(*b) < path_cache::name_at(i))) {
+      emit(*b++);
+    } else {
+      if (b != builtins.end() && *b == path_cache::name_at(i)) {
+        ++b;
+      }
+      emit(path_cache::name_at(i++));
+    }
+  }
+  matches[n] = nullptr;
+  return matches;
 }
 
 } // namespace completion
-
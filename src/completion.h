@@ -1,14 +1,25 @@
 #ifndef COMPLETION_H
 #define COMPLETION_H
 
+#include <cstddef>
 #include <string>
 #include <vector>
 
 namespace completion {
 
+struct Stats {
+  size_t nodes;          // Trie nodes, root included
+  size_t bytes;          // Approximate heap footprint of the trie
+  size_t snapshot_bytes; // Size of the PATH snapshot the completer searches
+  bool snapshot_mapped;  // Snapshot is mapped from the cache file rather than held in memory
+  size_t entries;        // Distinct completable words, builtins plus PATH snapshot entries
+};
+
 void setup();
 void register_commands(const std::vector<std::string> &cmds);
+void unregister_command(const std::string &cmd);
 char **completer(const char *word, int start, int end);
+Stats stats();
 
 } // namespace completion
 
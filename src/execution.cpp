@@ -1,23 +1,146 @@
 #include "execution.h"
 #include "builtin.h"
 #include "path.h"
+#include "stats.h"
 
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <sched.h>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 using namespace std;
 
+namespace {
+size_t pipe_capacity_bytes = 0; // 0 keeps the kernel default
+
+// Placement of pipeline stages, see exe::set_pipeline_affinity
+enum class AffinityMode { Off, Spread, Confine };
+AffinityMode affinity_mode = AffinityMode::Off;
+vector<int> affinity_cpus; // Spread with an empty list uses the shell's own allowed CPUs
+string affinity_spec = "off";
+optional<int> stage_nice;
+
+// What a stage observed after applying its placement, written into shared memory
+struct StageReport {
+  bool applied;
+  int nice;
+  cpu_set_t cpus;
+};
+
+// Parses a Linux CPU list such as "0-3,6"
+optional<vector<int>> parse_cpu_list(const string &list) {
+  vector<int> cpus;
+  istringstream ss(list);
+  string range;
+  while (getline(ss, range, ',')) {
+    char *end;
+    long first = strtol(range.c_str(), &end, 10);
+    long last = first;
+    if (*end == '-') {
+      last = strtol(end + 1, &end, 10);
+    }
+    if (range.empty() || *end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) {
+      return nullopt;
+    }
+    for (long cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(static_cast<int>(cpu));
+    }
+  }
+  if (cpus.empty()) {
+    return nullopt;
+  }
+  return cpus;
+}
+
+string format_cpu_set(const cpu_set_t &set) {
+  string out;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (!CPU_ISSET(cpu, &set)) {
+      continue;
+    }
+    int last = cpu;
+    while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &set)) {
+      ++last;
+    }
+    out += (out.empty() ? "" : ",") + to_string(cpu) + (last > cpu ? "-" + to_string(last) : "");
+    cpu = last;
+  }
+  return out;
+}
+
+vector<int> allowed_cpus() {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  vector<int> cpus;
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+  return cpus;
+}
+
+// CPUs stage `i` is pinned to; empty leaves the stage unpinned
+cpu_set_t stage_cpu_set(size_t i, const vector<int> &pool) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (pool.empty()) {
+    return set;
+  }
+  if (affinity_mode == AffinityMode::Spread) {
+    CPU_SET(pool[i % pool.size()], &set);
+  } else {
+    for (int cpu : pool) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  return set;
+}
+
+// Runs in the stage's child before it execs; reports what actually took effect
+void apply_placement(const cpu_set_t &cpus, StageReport *report) {
+  if (CPU_COUNT(&cpus) && sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+    cerr << "Warning: sched_setaffinity failed: " << strerror(errno) << endl;
+  }
+  if (stage_nice) {
+    errno = 0;
+    if (nice(*stage_nice) == -1 && errno != 0) {
+      cerr << "Warning: nice failed: " << strerror(errno) << endl;
+    }
+  }
+  if (report) {
+    report->applied = true;
+    errno = 0;
+    report->nice = getpriority(PRIO_PROCESS, 0);
+    CPU_ZERO(&report->cpus);
+    sched_getaffinity(0, sizeof(report->cpus), &report->cpus);
+  }
+}
+} // namespace
+
 namespace exe {
-int execute_external(const string &cmd, const string &path, const vector<string> &args) {
+pid_t spawn_external(const string &cmd, const string &path, const vector<string> &args, int out_fd, int err_fd) {
   pid_t pid = fork();
   if (pid == -1) {
     cerr << "fork failed: " << strerror(errno) << endl;
-    return 127;
-  } else if (pid == 0) {
+  } else if (pid > 0) {
+    stats::counters().forks++;
+  } else {
+    if (out_fd != -1) {
+      dup2(out_fd, STDOUT_FILENO);
+    }
+    if (err_fd != -1) {
+      dup2(err_fd, STDERR_FILENO);
+    }
     vector<char *> argv;
     argv.push_back(const_cast<char *>(cmd.c_str()));
     for (const auto &arg : args) {
@@ -26,17 +149,26 @@ int execute_external(const string &cmd, const string &path, const vector<string>
     argv.push_back(nullptr);
     execv(path.c_str(), argv.data());
     exit(127);
-  } else {
-    int status;
-    waitpid(pid, &status, 0);
-    return WEXITSTATUS(status);
   }
+  return pid;
+}
+
+int execute_external(const string &cmd, const string &path, const vector<string> &args) {
+  pid_t pid = spawn_external(cmd, path, args);
+  if (pid == -1) {
+    return 127;
+  }
+  int status;
+  stats::timed_waitpid(pid, &status, 0);
+  return WEXITSTATUS(status);
 }
 
 int execute(const ParsedCommand &parsed) {
   int exit_code;
-  if (builtin::is_builtin(parsed.cmd)) {
-    exit_code = builtin::execute(parsed.cmd, parsed.args);
+  stats::counters().commands++;
+  if (auto handler = builtin::find(parsed.cmd)) {
+    stats::counters().builtin_runs++;
+    exit_code = handler(parsed.args);
   } else if (auto path = path::find_in_path(parsed.cmd)) {
     exit_code = execute_external(parsed.cmd, *path, parsed.args);
   } else {
@@ -46,49 +178,98 @@ int execute(const ParsedCommand &parsed) {
   return exit_code;
 }
 
-void execute_pipeline(const vector<ParsedCommand> &cmds, const function<int(const ParsedCommand &)> &executor) {
+void set_pipe_capacity(size_t bytes) { pipe_capacity_bytes = bytes; }
+
+size_t pipe_capacity() { return pipe_capacity_bytes; }
+
+bool set_pipeline_affinity(const string &spec) {
+  if (spec.empty() || spec == "off") {
+    affinity_mode = AffinityMode::Off;
+    affinity_cpus.clear();
+    affinity_spec = "off";
+    return true;
+  }
+  bool spread = spec.starts_with("spread");
+  optional<vector<int>> cpus = vector<int>{};
+  if (spec != "spread") {
+    cpus = parse_cpu_list(spread ? (spec[6] == ':' ? spec.substr(7) : "") : spec);
+  }
+  if (!cpus) {
+    return false;
+  }
+  affinity_mode = spread ? AffinityMode::Spread : AffinityMode::Confine;
+  affinity_cpus = std::move(*cpus);
+  affinity_spec = spec;
+  return true;
+}
+
+string pipeline_affinity() { return affinity_spec; }
+
+void set_pipeline_nice(optional<int> increment) { stage_nice = increment; }
+
+optional<int> pipeline_nice() { return stage_nice; }
+
+int execute_pipeline(const vector<ParsedCommand> &cmds, const function<int(const ParsedCommand &)> &executor) {
   int N = cmds.size();
   using FileDescriptor = int;
   std::optional<FileDescriptor> read_from = std::nullopt;
-  std::optional<FileDescriptor> write_to = std::nullopt;
   vector<pid_t> to_wait{};
 
+  // Stages report their effective placement through a shared page so `shellstats` can show it
+  bool place = affinity_mode != AffinityMode::Off || stage_nice;
+  vector<int> pool = affinity_mode == AffinityMode::Spread && affinity_cpus.empty() ? allowed_cpus() : affinity_cpus;
+  StageReport *reports = nullptr;
+  if (place) {
+    void *shared = mmap(nullptr, N * sizeof(StageReport), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    reports = shared == MAP_FAILED ? nullptr : static_cast<StageReport *>(shared);
+  }
+
   for (auto i{0uz}; i != N; i++) {
-    FileDescriptor fd[2];
+    // Every pipe end is close-on-exec: a stage only keeps what it dup2'd onto 0/1
+    FileDescriptor fd[2] = {-1, -1};
     if (i < N - 1) {
-      pipe(fd);
-      write_to = fd[1];
-    } else {
-      write_to = std::nullopt;
+      if (pipe2(fd, O_CLOEXEC) == -1) {
+        cerr << "pipe failed: " << strerror(errno) << endl;
+        break;
+      }
+      if (pipe_capacity_bytes && fcntl(fd[1], F_SETPIPE_SZ, static_cast<int>(pipe_capacity_bytes)) == -1) {
+        cerr << "Warning: failed to set pipe size to " << pipe_capacity_bytes << ": " << strerror(errno) << endl;
+      }
     }
     auto pid = fork();
     if (pid == -1) { // FORK ERROR
-      close(fd[0]), close(fd[1]);
-      cerr << "Fork error, exiting.";
+      cerr << "fork failed: " << strerror(errno) << endl;
+      if (fd[0] != -1) {
+        close(fd[0]), close(fd[1]);
+      }
+      break;
     } else if (pid == 0) { // CHILD
+      // Drop every pipe end this stage does not own, including the read end of
+      // its own output pipe, so EOF and SIGPIPE reach neighbours as soon as they exit
       if (read_from) {
         dup2(*read_from, STDIN_FILENO);
+        close(*read_from);
+      }
+      if (fd[1] != -1) {
+        dup2(fd[1], STDOUT_FILENO);
+        close(fd[1]);
+        close(fd[0]);
       }
-      if (write_to) {
-        dup2(*write_to, STDOUT_FILENO);
+      if (place) {
+        apply_placement(stage_cpu_set(i, pool), reports ? &reports[i] : nullptr);
       }
-      int code = executor(cmds[i]);
+      exit(executor(cmds[i]));
+    } else { // PARENT
+      stats::counters().commands++;
+      stats::counters().forks++;
       if (read_from) {
         close(*read_from);
       }
-      if (write_to) {
-        close(*write_to);
-      }
-      exit(code);
-    } else { // PARENT
-      if (i < N - 1) {
-        if (write_to) {
-          close(*write_to);
-        }
-        if (read_from) {
-          close(*read_from);
-        }
+      if (fd[1] != -1) {
+        close(fd[1]);
         read_from = fd[0];
+      } else {
+        read_from = std::nullopt;
       }
       to_wait.push_back(pid);
     }
@@ -96,12 +277,26 @@ void execute_pipeline(const vector<ParsedCommand> &cmds, const function<int(cons
   if (read_from) {
     close(*read_from);
   }
-  if (to_wait.size()) {
-    for (auto child_pid : to_wait) {
-      int status;
-      waitpid(child_pid, &status, 0);
+  int status = 0;
+  for (auto child_pid : to_wait) {
+    stats::timed_waitpid(child_pid, &status, 0);
+  }
+
+  if (place) {
+    auto &placement = stats::counters().last_pipeline;
+    placement.clear();
+    for (size_t i = 0; i < to_wait.size(); ++i) {
+      stats::StagePlacement stage{cmds[i].cmd, format_cpu_set(stage_cpu_set(i, pool)), "", 0};
+      if (reports && reports[i].applied) {
+        stage.effective_cpus = format_cpu_set(reports[i].cpus);
+        stage.nice = reports[i].nice;
+      }
+      placement.push_back(std::move(stage));
     }
   }
+  if (reports) {
+    munmap(reports, N * sizeof(StageReport));
+  }
+  return WEXITSTATUS(status);
 }
 } // namespace exe
-
@@ -4,7 +4,9 @@
 #include "command.h"
 
 #include <functional>
+#include <optional>
 #include <string>
+#include <sys/types.h>
 #include <vector>
 
 using namespace std;
@@ -12,9 +14,28 @@ using namespace command;
 
 namespace exe {
 
+// Forks and execs `path` without waiting. `out_fd`/`err_fd`, when not -1, are
+// dup'd onto the child's stdout/stderr. Returns the child pid, or -1 on failure.
+pid_t spawn_external(const string &cmd, const string &path, const vector<string> &args, int out_fd = -1,
+                     int err_fd = -1);
 int execute_external(const string &cmd, const string &path, const vector<string> &args);
 int execute(const ParsedCommand &parsed);
-void execute_pipeline(const vector<ParsedCommand> &cmds, const function<int(const ParsedCommand &)> &executor);
+// Capacity requested with F_SETPIPE_SZ for each pipeline pipe, 0 for the kernel default
+void set_pipe_capacity(size_t bytes);
+size_t pipe_capacity();
+// Placement of pipeline stages, applied in each stage's child before it runs:
+//   off          leave stages wherever the scheduler puts them
+//   spread       pin stage i to the i-th CPU the shell may run on (round-robin)
+//   spread:LIST  pin stage i to the i-th CPU of LIST, e.g. spread:0-3,8
+//   LIST         confine every stage to the CPUs in LIST
+// Returns false if `spec` is invalid.
+bool set_pipeline_affinity(const string &spec);
+string pipeline_affinity();
+// Niceness increment applied to every stage, nullopt to leave it unchanged
+void set_pipeline_nice(optional<int> increment);
+optional<int> pipeline_nice();
+// Returns the exit status of the last stage
+int execute_pipeline(const vector<ParsedCommand> &cmds, const function<int(const ParsedCommand &)> &executor);
 } // namespace exe
 
 #endif
@@ -4,6 +4,8 @@
 #include "execution.h"
 #include "parsing.h"
 #include "path.h"
+#include "path_cache.h"
+#include "prompt.h"
 #include "redirection_guard.h"
 
 #include <cerrno>
@@ -40,29 +42,27 @@ bool history_enabled = true;
 
 } // namespace
 
-namespace constants {
-const char *PROMPT = "$ ";
-} // namespace constants
-
 int main() {
   // Flush after every std::cout / std:cerr
   cout << unitbuf;
   cerr << unitbuf;
 
   completion::setup();
+  prompt::setup();
 
   vector<string> commands = builtin::get_builtin_names();
   completion::register_commands(commands);
 
-  vector<string> executables = path::get_all_executables();
-  completion::register_commands(executables);
+  // PATH commands are completed straight from the mapped snapshot, no trie rebuild
+  path_cache::load();
 
   if (char *history_file = getenv("HISTFILE"); history_file && read_history(history_file) == 0) {
     atexit([]() { write_history(getenv("HISTFILE")); });
   }
 
+  int last_status = 0;
   while (true) {
-    unique_ptr<char, decltype(&free)> line(readline(constants::PROMPT), free);
+    unique_ptr<char, decltype(&free)> line(readline(prompt::render(last_status).c_str()), free);
 
     if (!line) {
       break; // EOF (Ctrl+D)
@@ -94,11 +94,18 @@ int main() {
     const auto N = sub_commands.size();
     if (N == 1) {
       RedirectionGuard guard(sub_commands[0].redirection);
-      [[maybe_unused]] auto code = exe::execute(sub_commands[0]);
+      if (!guard.ok()) {
+        last_status = 1;
+        continue;
+      }
+      last_status = exe::execute(sub_commands[0]);
+      if (sub_commands[0].cmd == "exec" && sub_commands[0].args.empty()) {
+        guard.persist(); // `exec 3>file` keeps its descriptors open
+      }
     } else {
-      exe::execute_pipeline(sub_commands, [&](const ParsedCommand &cmd) {
+      last_status = exe::execute_pipeline(sub_commands, [&](const ParsedCommand &cmd) {
         RedirectionGuard guard(cmd.redirection);
-        return exe::execute(cmd);
+        return guard.ok() ? exe::execute(cmd) : 1;
       });
     }
   }
@@ -1,12 +1,65 @@
 #include "parsing.h"
 #include "command.h"
 
+#include <algorithm>
+#include <cctype>
 #include <optional>
 #include <string>
 
 using namespace std;
 using namespace command;
 
+namespace {
+
+// Recognises [n]<, [n]>, [n]>>, [n]>&m, [n]<&m and [n]>&-, where n and m are single digits.
+// A file name may be attached (`>out.txt`); otherwise the next token supplies it.
+// Only the first `unquoted` characters can form the operator: `"3>2"` and `\>x` are plain words.
+optional<FdRedirection> parse_redirection(const string &token, size_t unquoted) {
+  using Kind = FdRedirection::Kind;
+  const size_t limit = min(token.size(), unquoted);
+  size_t i = 0;
+  int fd = -1;
+  if (i < limit && isdigit(static_cast<unsigned char>(token[i]))) {
+    fd = token[i++] - '0';
+  }
+  if (i == limit || (token[i] != '<' && token[i] != '>')) {
+    return nullopt;
+  }
+
+  FdRedirection redir{};
+  if (token[i++] == '<') {
+    redir.fd = fd == -1 ? 0 : fd;
+    redir.kind = Kind::Read;
+  } else {
+    redir.fd = fd == -1 ? 1 : fd;
+    redir.kind = Kind::Write;
+    if (i < limit && token[i] == '>') {
+      redir.kind = Kind::Append;
+      ++i;
+    }
+  }
+
+  if (i < limit && token[i] == '&') {
+    string target = token.substr(i + 1);
+    if (redir.kind == Kind::Append) {
+      return nullopt;
+    }
+    if (target == "-") {
+      redir.kind = Kind::Close;
+    } else if (target.size() == 1 && isdigit(static_cast<unsigned char>(target[0]))) {
+      redir.kind = Kind::Dup;
+      redir.target = target[0] - '0';
+    } else {
+      return nullopt;
+    }
+    return redir;
+  }
+  redir.file = token.substr(i);
+  return redir;
+}
+
+} // namespace
+
 namespace parsing {
 
 ParsedCommand parse(const string &input) {
@@ -15,34 +68,22 @@ ParsedCommand parse(const string &input) {
   bool s_quote{false};
   bool d_quote{false};
   bool escaped{false};
+  size_t unquoted = string::npos; // Length of the unquoted prefix of `current`
 
-  enum class NextToken { Normal, InputFile, OutputFile, ErrorFile };
-  NextToken next_token = NextToken::Normal;
+  optional<FdRedirection> pending; // Redirection still waiting for its file name
 
   auto process_token = [&](const string &token) {
-    if (next_token == NextToken::InputFile) {
-      result.redirection.input_file = token;
-      next_token = NextToken::Normal;
-    } else if (next_token == NextToken::OutputFile) {
-      result.redirection.output_file = token;
-      next_token = NextToken::Normal;
-    } else if (next_token == NextToken::ErrorFile) {
-      result.redirection.error_file = token;
-      next_token = NextToken::Normal;
-    } else if (token == "<") {
-      next_token = NextToken::InputFile;
-    } else if (token == ">" || token == "1>") {
-      result.redirection.append_output = false;
-      next_token = NextToken::OutputFile;
-    } else if (token == ">>" || token == "1>>") {
-      result.redirection.append_output = true;
-      next_token = NextToken::OutputFile;
-    } else if (token == "2>") {
-      result.redirection.append_error = false;
-      next_token = NextToken::ErrorFile;
-    } else if (token == "2>>") {
-      result.redirection.append_error = true;
-      next_token = NextToken::ErrorFile;
+    if (pending) {
+      pending->file = token;
+      result.redirection.fds.push_back(std::move(*pending));
+      pending.reset();
+    } else if (auto redir = parse_redirection(token, unquoted)) {
+      bool needs_file = redir->kind != FdRedirection::Kind::Dup && redir->kind != FdRedirection::Kind::Close;
+      if (needs_file && redir->file.empty()) {
+        pending = std::move(redir);
+      } else {
+        result.redirection.fds.push_back(std::move(*redir));
+      }
     } else {
       if (result.cmd.empty()) {
         result.cmd = token;
@@ -52,9 +93,12 @@ ParsedCommand parse(const string &input) {
     }
   };
 
+  auto mark_quoted = [&]() { unquoted = min(unquoted, current.size()); };
+
   for (size_t i = 0; i < input.size(); i++) {
     char c = input[i];
     if (escaped) {
+      mark_quoted();
       current += c;
       escaped = false;
     } else if (c == '\\' && !s_quote) {
@@ -74,14 +118,17 @@ ParsedCommand parse(const string &input) {
         escaped = true;
       }
     } else if (c == '\"' && !s_quote) {
+      mark_quoted();
       d_quote = !d_quote;
     } else if (c == '\'' && !d_quote) {
+      mark_quoted();
       s_quote = !s_quote;
     } else if (c == ' ' && !s_quote && !d_quote) {
       if (!current.empty()) {
         process_token(current);
         current.clear();
       }
+      unquoted = string::npos;
     } else {
       current += c;
     }
@@ -0,0 +1,334 @@
+#include "path_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr char MAGIC[8] = {'S', 'H', 'C', 'I', 'D', 'X', '0', '1'};
+
+// On-disk layout: Header, PATH bytes, Entry[count] (sorted by name), string blob.
+// Offsets are from the start of the file.
+struct Header {
+  char magic[8];
+  uint64_t key;        // Hash of PATH and every PATH directory's stat identity
+  uint32_t count;      // Number of entries
+  uint32_t path_len;   // Length of the PATH string following the header
+  uint64_t entries_at; // Offset of the Entry table
+};
+
+struct Entry {
+  uint32_t name_at;
+  uint32_t name_len;
+  uint32_t path_at;
+  uint32_t path_len;
+};
+
+class Snapshot {
+public:
+  Snapshot() = default;
+  ~Snapshot() { release(); }
+  Snapshot(const Snapshot &) = delete;
+  Snapshot &operator=(const Snapshot &) = delete;
+
+  // Adopts a read-only mapping of a cache file
+  bool map(int fd, size_t size) {
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      return false;
+    }
+    release();
+    data_ = static_cast<const char *>(addr);
+    size_ = size;
+    mapped_ = true;
+    return true;
+  }
+
+  // Adopts an in-memory image, used when the cache file cannot be written
+  void own(string image) {
+    release();
+    owned_ = std::move(image);
+    data_ = owned_.data();
+    size_ = owned_.size();
+  }
+
+  // Checks the image is well-formed and was built for `key` and `path_env`
+  bool valid(uint64_t key, string_view path_env) const {
+    if (!data_ || size_ < sizeof(Header)) {
+      return false;
+    }
+    const Header *h = header();
+    if (memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0 || h->key != key ||
+        string_view(data_ + sizeof(Header), min<size_t>(h->path_len, size_ - sizeof(Header))) != path_env ||
+        h->entries_at % alignof(Entry) != 0 || h->entries_at + uint64_t(h->count) * sizeof(Entry) > size_) {
+      return false;
+    }
+    for (uint32_t i = 0; i < h->count; ++i) {
+      const Entry &e = entries()[i];
+      if (uint64_t(e.name_at) + e.name_len > size_ || uint64_t(e.path_at) + e.path_len > size_) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint32_t count() const { return data_ ? header()->count : 0; }
+  size_t bytes() const { return size_; }
+  bool mapped() const { return mapped_; }
+  string_view name(uint32_t i) const { return {data_ + entries()[i].name_at, entries()[i].name_len}; }
+  string_view path(uint32_t i) const { return {data_ + entries()[i].path_at, entries()[i].path_len}; }
+
+private:
+  const Header *header() const { return reinterpret_cast<const Header *>(data_); }
+  const Entry *entries() const { return reinterpret_cast<const Entry *>(data_ + header()->entries_at); }
+
+  void release() {
+    if (mapped_) {
+      munmap(const_cast<char *>(data_), size_);
+    }
+    owned_.clear();
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+  }
+
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  string owned_;
+};
+
+Snapshot snapshot;
+optional<uint64_t> loaded_key; // Key of the PATH state the snapshot was loaded for
+
+vector<string> path_dirs(const string &path_env) {
+  vector<string> dirs;
+  istringstream ss(path_env);
+  string dir;
+  while (getline(ss, dir, ':')) {
+    dirs.push_back(dir);
+  }
+  return dirs;
+}
+
+// FNV-1a
+void mix(uint64_t &h, const void *data, size_t len) {
+  auto bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < len; ++i) {
+    h = (h ^ bytes[i]) * 1099511628211ULL;
+  }
+}
+
+uint64_t cache_key(const string &path_env, const vector<string> &dirs) {
+  uint64_t h = 14695981039346656037ULL;
+  mix(h, path_env.data(), path_env.size());
+  for (const auto &dir : dirs) {
+    struct stat st {};
+    if (stat(dir.c_str(), &st) == 0) {
+      uint64_t id[] = {uint64_t(st.st_dev), uint64_t(st.st_ino), uint64_t(st.st_mtim.tv_sec),
+                       uint64_t(st.st_mtim.tv_nsec)};
+      mix(h, id, sizeof(id));
+    } else {
+      mix(h, "-", 1);
+    }
+  }
+  return h;
+}
+
+// $XDG_CACHE_HOME/shell-cpp (or ~/.cache/shell-cpp), created if missing
+optional<string> cache_dir() {
+  string base;
+  if (const char *xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg == '/') {
+    base = xdg;
+  } else if (const char *home = getenv("HOME"); home && *home) {
+    base = string(home) + "/.cache";
+  } else {
+    return nullopt;
+  }
+  mkdir(base.c_str(), 0700);
+  string dir = base + "/shell-cpp";
+  if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+    return nullopt;
+  }
+  return dir;
+}
+
+// Scans PATH in order, keeping the first executable found for each name
+string build_image(uint64_t key, const string &path_env, const vector<string> &dirs) {
+  map<string, string> commands;
+  for (const auto &dir : dirs) {
+    DIR *dirp = opendir(dir.c_str());
+    if (!dirp)
+      continue;
+
+    struct dirent *entry;
+    while ((entry = readdir(dirp)) != nullptr) {
+      if (entry->d_name[0] == '.' || commands.count(entry->d_name))
+        continue;
+
+      string full_path = dir + "/" + entry->d_name;
+      if (access(full_path.c_str(), X_OK) == 0) {
+        commands.emplace(entry->d_name, std::move(full_path));
+      }
+    }
+    closedir(dirp);
+  }
+
+  Header h{};
+  memcpy(h.magic, MAGIC, sizeof(MAGIC));
+  h.key = key;
+  h.count = static_cast<uint32_t>(commands.size());
+  h.path_len = static_cast<uint32_t>(path_env.size());
+  h.entries_at = (sizeof(Header) + path_env.size() + alignof(Entry) - 1) / alignof(Entry) * alignof(Entry);
+
+  string image(h.entries_at + commands.size() * sizeof(Entry), '\0');
+  vector<Entry> entries;
+  entries.reserve(commands.size());
+  for (const auto &[name, full_path] : commands) {
+    Entry e{};
+    e.name_at = static_cast<uint32_t>(image.size());
+    e.name_len = static_cast<uint32_t>(name.size());
+    image += name;
+    e.path_at = static_cast<uint32_t>(image.size());
+    e.path_len = static_cast<uint32_t>(full_path.size());
+    image += full_path;
+    entries.push_back(e);
+  }
+  memcpy(image.data(), &h, sizeof(h));
+  memcpy(image.data() + sizeof(Header), path_env.data(), path_env.size());
+  if (!entries.empty()) {
+    memcpy(image.data() + h.entries_at, entries.data(), entries.size() * sizeof(Entry));
+  }
+  return image;
+}
+
+bool map_file(const string &file, uint64_t key, const string &path_env) {
+  int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat st {};
+  bool ok = fstat(fd, &st) == 0 && st.st_size > 0 && snapshot.map(fd, st.st_size) && snapshot.valid(key, path_env);
+  close(fd);
+  return ok;
+}
+
+// Writes to a temporary file and renames it, so concurrent shells never see a partial image
+bool write_file(const string &file, const string &image) {
+  string tmp = file + "." + to_string(getpid());
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    return false;
+  }
+  size_t off = 0;
+  while (off < image.size()) {
+    ssize_t n = write(fd, image.data() + off, image.size() - off);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    off += n;
+  }
+  bool ok = close(fd) == 0 && off == image.size() && rename(tmp.c_str(), file.c_str()) == 0;
+  if (!ok) {
+    unlink(tmp.c_str());
+  }
+  return ok;
+}
+
+} // namespace
+
+namespace path_cache {
+
+void load() {
+  const char *env = getenv("PATH");
+  if (!env) {
+    return;
+  }
+  string path_env(env);
+  auto dirs = path_dirs(path_env);
+  uint64_t key = cache_key(path_env, dirs);
+  if (loaded_key == key) {
+    return;
+  }
+  loaded_key = key;
+
+  // One file per PATH value; the directory mtimes are checked through the key
+  uint64_t path_hash = 14695981039346656037ULL;
+  mix(path_hash, path_env.data(), path_env.size());
+  char name[32];
+  snprintf(name, sizeof(name), "/commands-%016llx", static_cast<unsigned long long>(path_hash));
+
+  auto dir = cache_dir();
+  string file = dir ? *dir + name : "";
+  if (dir && map_file(file, key, path_env)) {
+    return;
+  }
+
+  string image = build_image(key, path_env, dirs);
+  if (dir && write_file(file, image) && map_file(file, key, path_env)) {
+    return;
+  }
+  snapshot.own(std::move(image));
+}
+
+uint32_t size() { return snapshot.count(); }
+
+string_view name_at(uint32_t i) { return snapshot.name(i); }
+
+size_t image_bytes() { return snapshot.bytes(); }
+
+bool mapped() { return snapshot.mapped(); }
+
+pair<uint32_t, uint32_t> prefix_range(string_view prefix) {
+  // First index for which `before(i)` is false; names are sorted, so each predicate is a partition
+  auto partition_point = [](auto before) {
+    uint32_t lo = 0, hi = snapshot.count();
+    while (lo < hi) {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (before(snapshot.name(mid))) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  };
+  uint32_t first = partition_point([&](string_view name) { return name < prefix; });
+  uint32_t last = partition_point([&](string_view name) { return name.substr(0, prefix.size()) <= prefix; });
+  return {first, last};
+}
+
+optional<string_view> lookup(string_view name) {
+  uint32_t lo = 0, hi = snapshot.count();
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    auto cmp = snapshot.name(mid).compare(name);
+    if (cmp == 0) {
+      return snapshot.path(mid);
+    }
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return nullopt;
+}
+
+} // namespace path_cache
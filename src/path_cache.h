@@ -0,0 +1,35 @@
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+// Snapshot of every executable reachable through PATH, persisted under
+// $XDG_CACHE_HOME/shell-cpp and memory-mapped read-only on the next launch.
+// The sorted name table doubles as the completion index for PATH commands.
+// The snapshot is keyed on PATH and the mtime of each PATH directory, so a warm
+// start only stat()s the directories instead of scanning them.
+namespace path_cache {
+
+// Maps the snapshot for the current PATH, rebuilding it on a miss. Calling it again stat()s
+// the PATH directories and reloads only if one of them changed since the last call.
+void load();
+// Number of commands in the snapshot
+uint32_t size();
+// Name of the i-th command in sorted order; views stay valid until load() reloads
+std::string_view name_at(uint32_t i);
+// Size of the snapshot image, whether mapped from the cache file or held in memory
+size_t image_bytes();
+// True when the image is mapped from the cache file
+bool mapped();
+// Index range [first, last) of the sorted names starting with `prefix`
+std::pair<uint32_t, uint32_t> prefix_range(std::string_view prefix);
+// Full path of the first PATH match for `name`, if the snapshot has one
+std::optional<std::string_view> lookup(std::string_view name);
+
+} // namespace path_cache
+
+#endif
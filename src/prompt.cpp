@@ -0,0 +1,324 @@
+#include "prompt.h"
+
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <mutex>
+#include <optional>
+#include <pwd.h>
+#include <readline/readline.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+using namespace std;
+
+namespace {
+
+constexpr const char *DEFAULT_PROMPT = "$ ";
+
+// A directory waiting to be computed, with the pipe its command will write to
+struct SegmentRequest {
+  string dir;
+  int fd[2];
+};
+
+// Background evaluation of $PS1_COMMAND, cached per directory.
+// Heap-allocated and never freed so the detached worker can outlive static destruction.
+struct AsyncSegment {
+  mutex mtx;
+  condition_variable cv;
+  unordered_map<string, string> cache; // directory -> last computed value
+  optional<SegmentRequest> pending;
+  atomic<bool> updated{false}; // set by the worker, consumed by the event hook
+  bool started = false;
+};
+
+AsyncSegment &segment() {
+  static auto *seg = new AsyncSegment;
+  return *seg;
+}
+
+int last_status_ = 0;
+string rendered_;
+bool refresh_enabled_ = false; // \g is in PS1 and stdin is a terminal
+
+// Worker fds live at 10 and above, out of reach of user redirections on fds 0-9
+constexpr int WORKER_FD_MIN = 10;
+
+bool move_above_user_fds(int &fd) {
+  int moved = fcntl(fd, F_DUPFD_CLOEXEC, WORKER_FD_MIN);
+  close(fd);
+  fd = moved;
+  return moved != -1;
+}
+
+// Called on the main thread, the only one applying redirections, so the low fds pipe2
+// hands out cannot be taken over by `cmd 3>f` before they are moved
+bool open_segment_pipe(int fd[2]) {
+  if (pipe2(fd, O_CLOEXEC) == -1) {
+    return false;
+  }
+  bool read_ok = move_above_user_fds(fd[0]);
+  bool write_ok = move_above_user_fds(fd[1]);
+  if (!read_ok || !write_ok) {
+    if (read_ok)
+      close(fd[0]);
+    if (write_ok)
+      close(fd[1]);
+    return false;
+  }
+  return true;
+}
+
+// Runs `command` with /bin/sh in `dir` and returns the first line of its stdout.
+// Takes ownership of both ends of `fd`.
+string run_segment_command(const string &command, const string &dir, const int fd[2]) {
+  pid_t pid = fork();
+  if (pid == -1) {
+    close(fd[0]), close(fd[1]);
+    return "";
+  }
+  if (pid == 0) {
+    int devnull = open("/dev/null", O_RDWR);
+    dup2(devnull, STDIN_FILENO);
+    dup2(devnull, STDERR_FILENO);
+    dup2(fd[1], STDOUT_FILENO);
+    if (chdir(dir.c_str()) != 0) {
+      _exit(1);
+    }
+    execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char *>(nullptr));
+    _exit(127);
+  }
+  close(fd[1]);
+  string out;
+  char buf[512];
+  ssize_t n;
+  while ((n = read(fd[0], buf, sizeof(buf))) > 0 || (n == -1 && errno == EINTR)) {
+    if (n > 0)
+      out.append(buf, n);
+  }
+  close(fd[0]);
+  // May fail with ECHILD if the shell reaped it first (parallel waits on any child)
+  waitpid(pid, nullptr, 0);
+  return out.substr(0, out.find('\n'));
+}
+
+void worker() {
+  auto &seg = segment();
+  while (true) {
+    SegmentRequest request;
+    {
+      unique_lock lock(seg.mtx);
+      seg.cv.wait(lock, [&] { return seg.pending.has_value(); });
+      request = std::move(*seg.pending);
+      seg.pending.reset();
+    }
+    const char *command = getenv("PS1_COMMAND");
+    string value;
+    if (command) {
+      value = run_segment_command(command, request.dir, request.fd);
+    } else {
+      close(request.fd[0]), close(request.fd[1]);
+    }
+    {
+      lock_guard lock(seg.mtx);
+      auto &slot = seg.cache[request.dir];
+      if (slot == value) {
+        continue;
+      }
+      slot = std::move(value);
+    }
+    seg.updated = true;
+  }
+}
+
+// Returns the cached value for `dir` immediately and schedules a refresh.
+// Without a terminal nothing would redraw the prompt, so no command is run.
+string async_value(const string &dir) {
+  auto &seg = segment();
+  int fd[2];
+  bool schedule = refresh_enabled_ && open_segment_pipe(fd);
+  lock_guard lock(seg.mtx);
+  if (schedule) {
+    if (!seg.started) {
+      seg.started = true;
+      thread(worker).detach();
+    }
+    if (seg.pending) {
+      close(seg.pending->fd[0]), close(seg.pending->fd[1]);
+    }
+    seg.pending = SegmentRequest{dir, {fd[0], fd[1]}};
+    seg.cv.notify_one();
+  }
+  auto it = seg.cache.find(dir);
+  return it == seg.cache.end() ? "" : it->second;
+}
+
+string current_dir() {
+  char cwd[PATH_MAX];
+  return getcwd(cwd, PATH_MAX) ? string(cwd) : string();
+}
+
+string user_name() {
+  if (const char *user = getenv("USER")) {
+    return user;
+  }
+  const passwd *pw = getpwuid(geteuid());
+  return pw ? pw->pw_name : "";
+}
+
+string host_name(bool full) {
+  char host[HOST_NAME_MAX + 1] = {};
+  gethostname(host, sizeof(host) - 1);
+  string result(host);
+  return full ? result : result.substr(0, result.find('.'));
+}
+
+string format_time(const char *format) {
+  time_t now = time(nullptr);
+  tm local{};
+  localtime_r(&now, &local);
+  char buf[32];
+  strftime(buf, sizeof(buf), format, &local);
+  return buf;
+}
+
+string expand(const string &ps1, bool refresh) {
+  string out;
+  string cwd;
+  auto cwd_cached = [&]() -> const string & {
+    if (cwd.empty())
+      cwd = current_dir();
+    return cwd;
+  };
+
+  for (size_t i = 0; i < ps1.size(); ++i) {
+    char c = ps1[i];
+    if (c == '$' && i + 1 < ps1.size() && ps1[i + 1] == '?') {
+      out += to_string(last_status_);
+      ++i;
+      continue;
+    }
+    if (c != '\\' || i + 1 == ps1.size()) {
+      out += c;
+      continue;
+    }
+    switch (ps1[++i]) {
+    case 'u':
+      out += user_name();
+      break;
+    case 'h':
+      out += host_name(false);
+      break;
+    case 'H':
+      out += host_name(true);
+      break;
+    case 'w': {
+      string dir = cwd_cached();
+      const char *home = getenv("HOME");
+      size_t len = home ? strlen(home) : 0;
+      if (len && dir.compare(0, len, home) == 0 && (dir.size() == len || dir[len] == '/')) {
+        dir.replace(0, len, "~");
+      }
+      out += dir;
+      break;
+    }
+    case 'W': {
+      const string &dir = cwd_cached();
+      out += dir == "/" ? dir : dir.substr(dir.rfind('/') + 1);
+      break;
+    }
+    case 't':
+      out += format_time("%H:%M:%S");
+      break;
+    case 'T':
+      out += format_time("%I:%M:%S");
+      break;
+    case 'A':
+      out += format_time("%H:%M");
+      break;
+    case '$':
+      out += geteuid() == 0 ? '#' : '$';
+      break;
+    case 'n':
+      out += '\n';
+      break;
+    case 'e':
+      out += '\033';
+      break;
+    case '[':
+      out += RL_PROMPT_START_IGNORE;
+      break;
+    case ']':
+      out += RL_PROMPT_END_IGNORE;
+      break;
+    case 'g':
+      if (refresh) {
+        out += async_value(cwd_cached());
+      } else {
+        auto &seg = segment();
+        lock_guard lock(seg.mtx);
+        auto it = seg.cache.find(cwd_cached());
+        out += it == seg.cache.end() ? "" : it->second;
+      }
+      break;
+    case '\\':
+      out += '\\';
+      break;
+    default:
+      out += '\\';
+      out += ps1[i];
+    }
+  }
+  return out;
+}
+
+// Called by readline while it waits for input; redraws once a segment changed
+int on_readline_idle() {
+  auto &seg = segment();
+  if (!seg.updated.exchange(false)) {
+    return 0;
+  }
+  const char *ps1 = getenv("PS1");
+  if (!ps1) {
+    return 0;
+  }
+  string next = expand(ps1, false);
+  if (next != rendered_) {
+    rendered_ = std::move(next);
+    rl_set_prompt(rendered_.c_str());
+    rl_redisplay();
+  }
+  return 0;
+}
+
+} // namespace
+
+namespace prompt {
+
+void setup() {
+  const char *ps1 = getenv("PS1");
+  // Redraws only matter on a terminal, and readline spins on the event hook at EOF of piped input
+  if (!ps1 || !strstr(ps1, "\\g") || !isatty(STDIN_FILENO)) {
+    return;
+  }
+  refresh_enabled_ = true;
+  rl_event_hook = on_readline_idle;
+  rl_set_keyboard_input_timeout(50000); // Poll the worker every 50ms while idle
+}
+
+string render(int last_status) {
+  last_status_ = last_status;
+  const char *ps1 = getenv("PS1");
+  rendered_ = ps1 ? expand(ps1, true) : DEFAULT_PROMPT;
+  return rendered_;
+}
+
+} // namespace prompt
@@ -0,0 +1,18 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+
+#include <string>
+
+// PS1 expansion. Supported escapes: \u \h \H \w \W \t \T \A \$ \n \e \\ \[ \] and $? for the
+// last exit status. \g expands to the first line printed by $PS1_COMMAND run in the current
+// directory; it is computed on a background thread, cached per directory, and the prompt is
+// redrawn from readline's event hook when a fresh value arrives.
+namespace prompt {
+
+void setup();
+// Expands PS1 (or the default prompt when unset) for the next readline call
+std::string render(int last_status);
+
+} // namespace prompt
+
+#endif
@@ -15,18 +15,35 @@ using namespace command;
 
 // RAII class to manage file descriptor redirections
 // Automatically saves original FDs, redirects them, and restores on destruction
+// Stops at the first redirection that fails; check ok() before running the command
 class RedirectionGuard {
 public:
   explicit RedirectionGuard(const Redirection &redir) {
-    if (redir.output_file.has_value()) {
-      setup_redirection(STDOUT_FILENO, *redir.output_file, redir.append_output);
-    }
-
-    if (redir.error_file.has_value()) {
-      setup_redirection(STDERR_FILENO, *redir.error_file, redir.append_error);
+    for (const auto &fd_redir : redir.fds) {
+      switch (fd_redir.kind) {
+      case FdRedirection::Kind::Read:
+        ok_ = setup_redirection(fd_redir.fd, fd_redir.file, O_RDONLY);
+        break;
+      case FdRedirection::Kind::Write:
+        ok_ = setup_redirection(fd_redir.fd, fd_redir.file, write_flags(false));
+        break;
+      case FdRedirection::Kind::Append:
+        ok_ = setup_redirection(fd_redir.fd, fd_redir.file, write_flags(true));
+        break;
+      case FdRedirection::Kind::Dup:
+        ok_ = setup_dup(fd_redir.fd, fd_redir.target);
+        break;
+      case FdRedirection::Kind::Close:
+        ok_ = save(fd_redir.fd);
+        if (ok_) {
+          close(fd_redir.fd);
+        }
+        break;
+      }
+      if (!ok_) {
+        break;
+      }
     }
-
-    // TODO: Handle stdin redirection (<) when needed
   }
 
   ~RedirectionGuard() { restore(); }
@@ -34,49 +51,101 @@ public:
   RedirectionGuard(const RedirectionGuard &) = delete;
   RedirectionGuard &operator=(const RedirectionGuard &) = delete;
 
+  // False when a redirection failed, the command must not run (`cat < missing.txt`)
+  bool ok() const { return ok_; }
+
+  // Keeps the redirections in place after destruction (`exec 3>file`)
+  void persist() {
+    for (const auto &fd : saved_fds_) {
+      if (fd.saved != -1) {
+        close(fd.saved);
+      }
+    }
+    saved_fds_.clear();
+  }
+
 private:
-  void setup_redirection(int fd, const std::string &filename, bool append) {
-    int saved = dup(fd);
-    if (saved == -1) {
+  // Saved copies live at 10 and above, out of reach of user fds 0-9, and are close-on-exec
+  static constexpr int SAVED_FD_MIN = 10;
+
+  static int write_flags(bool append) { return O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC); }
+
+  // Records how to restore `fd`; a closed fd is restored by closing it again
+  bool save(int fd) {
+    int saved = fcntl(fd, F_DUPFD_CLOEXEC, SAVED_FD_MIN);
+    if (saved == -1 && errno != EBADF) {
       std::cerr << "Warning: failed to save fd " << fd << ": " << strerror(errno) << std::endl;
-      return;
+      return false;
+    }
+    saved_fds_.push_back({fd, saved});
+    return true;
+  }
+
+  bool setup_redirection(int fd, const std::string &filename, int flags) {
+    if (!save(fd)) {
+      return false;
     }
 
-    int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
     int file = open(filename.c_str(), flags, 0644);
     if (file == -1) {
-      std::cerr << "Failed to open " << filename << ": " << strerror(errno) << std::endl;
-      close(saved);
-      return;
+      std::cerr << filename << ": " << strerror(errno) << std::endl;
+      return false;
     }
 
-    if (dup2(file, fd) == -1) {
+    if (file == fd) {
+      return true; // fd was closed and open() reused it
+    }
+    bool redirected = dup2(file, fd) != -1;
+    if (!redirected) {
       std::cerr << "Failed to redirect fd " << fd << ": " << strerror(errno) << std::endl;
-      close(file);
-      close(saved);
-      return;
     }
-
     close(file);
-    saved_fds_.push_back({fd, saved});
+    return redirected;
+  }
+
+  bool setup_dup(int fd, int target) {
+    if (fd == target) {
+      return true;
+    }
+    if (fcntl(target, F_GETFD) == -1) {
+      std::cerr << target << ": " << strerror(errno) << std::endl;
+      return false;
+    }
+    if (!save(fd)) {
+      return false;
+    }
+    if (dup2(target, fd) == -1) {
+      std::cerr << "Failed to redirect fd " << fd << ": " << strerror(errno) << std::endl;
+      return false;
+    }
+    return true;
   }
 
   void restore() {
     for (auto it = saved_fds_.rbegin(); it != saved_fds_.rend(); ++it) {
+      if (it->saved == -1) {
+        close(it->original);
+        continue;
+      }
       if (dup2(it->saved, it->original) == -1) {
         std::cerr << "Warning: failed to restore fd " << it->original << std::endl;
       }
       close(it->saved);
     }
     saved_fds_.clear();
+    // A builtin writing to a closed or read-only fd (`echo a >&-`) leaves badbit set,
+    // which would silence every later builtin
+    std::cout.clear();
+    std::cerr.clear();
   }
 
   struct SavedFD {
-    int original; // The original FD number (STDOUT_FILENO or STDERR_FILENO)
-    int saved;    // The dup'd FD to restore from
+    int original; // The redirected FD number
+    int saved;    // The dup'd FD to restore from, -1 if original was closed
   };
 
   std::vector<SavedFD> saved_fds_;
+  bool ok_ = true;
 };
 
 #endif
@@ -0,0 +1,66 @@
+#include "stats.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+#include <sys/wait.h>
+
+using namespace std;
+
+namespace {
+
+stats::Counters counters_;
+
+// Global allocator counters; relaxed atomics are enough for statistics
+atomic<uint64_t> allocs{0};
+atomic<uint64_t> frees{0};
+atomic<uint64_t> bytes_total{0};
+atomic<uint64_t> bytes_live{0};
+
+void *tracked_alloc(size_t size) {
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    throw bad_alloc();
+  }
+  allocs.fetch_add(1, memory_order_relaxed);
+  bytes_total.fetch_add(size, memory_order_relaxed);
+  bytes_live.fetch_add(malloc_usable_size(p), memory_order_relaxed);
+  return p;
+}
+
+void tracked_free(void *p) noexcept {
+  if (!p) {
+    return;
+  }
+  frees.fetch_add(1, memory_order_relaxed);
+  bytes_live.fetch_sub(malloc_usable_size(p), memory_order_relaxed);
+  free(p);
+}
+
+} // namespace
+
+void *operator new(size_t size) { return tracked_alloc(size); }
+void *operator new[](size_t size) { return tracked_alloc(size); }
+void operator delete(void *p) noexcept { tracked_free(p); }
+void operator delete[](void *p) noexcept { tracked_free(p); }
+void operator delete(void *p, size_t) noexcept { tracked_free(p); }
+void operator delete[](void *p, size_t) noexcept { tracked_free(p); }
+
+namespace stats {
+
+Counters &counters() { return counters_; }
+
+Allocations allocations() {
+  return {allocs.load(memory_order_relaxed), frees.load(memory_order_relaxed),
+          bytes_total.load(memory_order_relaxed), bytes_live.load(memory_order_relaxed)};
+}
+
+pid_t timed_waitpid(pid_t pid, int *status, int options) {
+  auto start = chrono::steady_clock::now();
+  pid_t result = waitpid(pid, status, options);
+  counters_.wait_time += chrono::steady_clock::now() - start;
+  return result;
+}
+
+} // namespace stats
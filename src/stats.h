@@ -0,0 +1,45 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// Activity counters for the shell process itself, reported by `shellstats`
+namespace stats {
+
+// Where one stage of the last placed pipeline ran
+struct StagePlacement {
+  std::string cmd;
+  std::string requested_cpus; // Empty when the stage was not pinned
+  std::string effective_cpus; // Affinity the stage read back after applying it
+  int nice;
+};
+
+struct Counters {
+  uint64_t commands = 0;     // Commands dispatched, each pipeline stage counted once
+  uint64_t builtin_runs = 0; // Builtins run in-process
+  uint64_t forks = 0;        // Children forked by the shell
+  std::chrono::nanoseconds wait_time{0}; // Cumulative time blocked in waitpid
+  std::vector<StagePlacement> last_pipeline; // Filled when pipeline affinity or nice is set
+};
+
+// Snapshot of the tracking operator new/delete
+struct Allocations {
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t bytes_total; // Bytes ever requested
+  uint64_t bytes_live;  // Usable bytes currently allocated
+};
+
+Counters &counters();
+Allocations allocations();
+
+// waitpid that accumulates the time spent blocked into counters().wait_time
+pid_t timed_waitpid(pid_t pid, int *status, int options);
+
+} // namespace stats
+
+#endif